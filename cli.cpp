@@ -0,0 +1,304 @@
+/*
+ * Functionality: Command-line front end for pipelines and job runners. Images are read
+ * from a file or stdin (buffered in memory) and the watermarked image is streamed to a
+ * file or stdout, so no temporary files are needed. Batch mode keeps one process alive
+ * for a newline-delimited list of jobs and caches the mark images between them.
+ *
+ * Usage:
+ *   watermark_cli embed  -m mark.bmp [-d delta] [-k key] [-i in.bmp|-] [-o out.bmp|-]
+ *   watermark_cli decode -m mark.bmp [-d delta] [-k key] [-i in.bmp|-]
+ *   watermark_cli sweep  -m mark.bmp [-i in.bmp|-] [--from d0] [--to d1] [--step s] [-s sigma]
+ *   watermark_cli bench  -m mark.bmp [-i in.bmp|-] [-d delta] [-n runs]
+ *   watermark_cli detect -m mark.bmp [-i in.bmp|-] [-d delta] [-W width] [-H height]
+ *   watermark_cli batch  < jobs.txt
+ * Each batch line holds one of the other commands (without the program name); its input
+ * and output must be files since stdin and stdout carry the job list and the results.
+ * -k key replaces the alternating spreading sequence with a Gaussian one seeded from a hash of the key string.
+ * detect searches scale and block-grid offset for cropped copies; -W/-H give the
+ * size of the original image (a square with one block per mark bit by default).
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <stdexcept>
+#include <cstdio>
+#include <cmath>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+#include "./include/dct_watermark.h"
+#include "./include/mark_detector.h"
+#include "./include/stdm_kernels.h"
+#include "./include/constants.h"
+
+using namespace std;
+
+// Options shared by all subcommands
+struct cli_options {
+    string command;
+    string mark;
+    string input = "-";
+    string output = "-";
+    double delta = 4;
+    double sigma = 0;
+    double from = 4;
+    double to = 4;
+    double step = 0.01;
+    int runs = 10;
+    int width = 0;
+    int height = 0;
+    string key;
+};
+
+// Mark images loaded so far, kept across batch jobs
+static map<string, unique_ptr<bitmap_image>> mark_cache;
+
+// Parses the subcommand and its flags
+static cli_options parse_options(const vector<string>& args) {
+    if (args.empty()) {
+        throw invalid_argument("missing command (embed, decode, sweep, bench, detect or batch)");
+    }
+
+    cli_options opt;
+    opt.command = args[0];
+    if (opt.command != "embed" && opt.command != "decode" && opt.command != "sweep" &&
+        opt.command != "bench" && opt.command != "detect" && opt.command != "batch") {
+        throw invalid_argument("unknown command " + opt.command);
+    }
+    for (size_t i = 1; i < args.size(); i++) {
+        const string& flag = args[i];
+        if (i + 1 >= args.size()) {
+            throw invalid_argument("missing value for " + flag);
+        }
+        const string& value = args[++i];
+        if (flag == "-m") opt.mark = value;
+        else if (flag == "-i") opt.input = value;
+        else if (flag == "-o") opt.output = value;
+        else if (flag == "-d") opt.delta = stod(value);
+        else if (flag == "-s") opt.sigma = stod(value);
+        else if (flag == "-n") opt.runs = stoi(value);
+        else if (flag == "-k") opt.key = value;
+        else if (flag == "-W") opt.width = stoi(value);
+        else if (flag == "-H") opt.height = stoi(value);
+        else if (flag == "--from") opt.from = stod(value);
+        else if (flag == "--to") opt.to = stod(value);
+        else if (flag == "--step") opt.step = stod(value);
+        else throw invalid_argument("unknown option " + flag);
+    }
+
+    if (opt.mark.empty() && opt.command != "batch") {
+        throw invalid_argument("a mark image (-m) is required");
+    }
+    if (opt.delta <= 0 || opt.step <= 0 || opt.runs <= 0) {
+        throw invalid_argument("delta, step and runs must be positive");
+    }
+    return opt;
+}
+
+// Reads an image from a file, or from stdin when path is "-"
+static unique_ptr<bitmap_image> read_image(const string& path) {
+    if (path != "-") {
+        return unique_ptr<bitmap_image>(new bitmap_image(path.c_str()));
+    }
+    // stdin is not seekable, so buffer it before parsing
+    stringstream buffer(ios::in | ios::out | ios::binary);
+    buffer << cin.rdbuf();
+    return unique_ptr<bitmap_image>(new bitmap_image(buffer));
+}
+
+// Returns the mark image, loading it on first use
+static const bitmap_image& get_mark(const string& path) {
+    unique_ptr<bitmap_image>& mark = mark_cache[path];
+    if (!mark) {
+        mark = read_image(path);
+    }
+    return *mark;
+}
+
+// Number of 8x8 blocks in the image
+static int block_count(const bitmap_image& bmp) {
+    return (bmp.height() / GRID_WIDTH) * (bmp.width() / GRID_WIDTH);
+}
+
+// Embeds the mark and writes the image to out
+static void embed_to(const bitmap_image& bmp, const bitmap_image& mark, const double delta, ostream& out) {
+    clear_pixel();
+    copy_bmp_pixel(bmp);
+    DCT(GRID_WIDTH);
+    embed_watermark(mark, block_count(bmp), delta);
+    save_bmp_watermark(bmp, out);
+    clear_pixel();
+}
+
+// Decodes the mark and returns the bit error rate
+static double decode_from(const bitmap_image& bmp, const bitmap_image& mark, const double delta) {
+    clear_pixel();
+    clear_res();
+    copy_bmp_pixel(bmp);
+    DCT(GRID_WIDTH);
+    double res = decode_watermark(mark, block_count(bmp), delta);
+    clear_pixel();
+    clear_res();
+    return 1 - res;
+}
+
+// Embeds and decodes in memory (optionally with noise) and returns the bit error rate
+static double round_trip(const bitmap_image& bmp, const bitmap_image& mark, const double delta, const double sigma) {
+    clear_pixel();
+    clear_res();
+    copy_bmp_pixel(bmp);
+    DCT(GRID_WIDTH);
+    embed_watermark(mark, block_count(bmp), delta);
+    inverse_DCT(GRID_WIDTH);
+    if (sigma > 0) {
+        add_noise(sigma);
+    }
+    copy_watermark_pixel();
+    DCT(GRID_WIDTH);
+    double res = decode_watermark(mark, block_count(bmp), delta);
+    clear_pixel();
+    clear_res();
+    return 1 - res;
+}
+
+// Runs one command; results go to out, images to the -o target
+static void run_command(const cli_options& opt, ostream& out, const bool batch) {
+    if (batch && (opt.input == "-" || opt.mark == "-" || (opt.command == "embed" && opt.output == "-"))) {
+        throw invalid_argument("batch jobs need file input and output");
+    }
+    if (opt.input == "-" && opt.mark == "-") {
+        throw invalid_argument("only one of -m and -i can read stdin");
+    }
+
+    const bitmap_image& mark = get_mark(opt.mark);
+    unique_ptr<bitmap_image> bmp = read_image(opt.input);
+
+    // The key is per job, so batch jobs never inherit another job's sequence
+    if (opt.key.empty()) {
+        set_spreading(vector<double>());
+    }
+    else {
+        // detect works on cropped copies, so its bits always span exactly one block
+        int n = (opt.command == "detect") ? GRID_WIDTH : block_count(*bmp) * GRID_WIDTH / (mark.width() * mark.height());
+        set_spreading(random_spreading(n, opt.key));
+    }
+
+    if (opt.command == "embed") {
+        if (opt.output == "-") {
+            embed_to(*bmp, mark, opt.delta, cout);
+            cout.flush();
+        }
+        else {
+            ofstream file(opt.output, ios::out | ios::binary);
+            if (!file) {
+                throw runtime_error("failed to open " + opt.output);
+            }
+            embed_to(*bmp, mark, opt.delta, file);
+            if (batch) {
+                out << "ok " << opt.output << endl;
+            }
+        }
+    }
+    else if (opt.command == "decode") {
+        out << setprecision(6) << decode_from(*bmp, mark, opt.delta) << endl;
+    }
+    else if (opt.command == "sweep") {
+        // Same columns as result1.txt/result2.txt: delta, experimental and theoretical error rate
+        for (double delta = opt.from; delta <= opt.to + 1e-9; delta += opt.step) {
+            out << delta << ' ' << setprecision(6) << round_trip(*bmp, mark, delta, opt.sigma)
+                << ' ' << theory_p_e(opt.sigma, delta) << endl;
+        }
+    }
+    else if (opt.command == "bench") {
+        ostringstream sink(ios::out | ios::binary);
+        auto start = chrono::steady_clock::now();
+        for (int i = 0; i < opt.runs; i++) {
+            sink.str("");
+            embed_to(*bmp, mark, opt.delta, sink);
+        }
+        auto mid = chrono::steady_clock::now();
+        for (int i = 0; i < opt.runs; i++) {
+            decode_from(*bmp, mark, opt.delta);
+        }
+        auto end = chrono::steady_clock::now();
+
+        out << "embed " << chrono::duration<double, milli>(mid - start).count() / opt.runs << " ms/image, "
+            << "decode " << chrono::duration<double, milli>(end - mid).count() / opt.runs << " ms/image" << endl;
+    }
+    else if (opt.command == "detect") {
+        int width = opt.width, height = opt.height;
+        if (!width || !height) {
+            int side = static_cast<int>(lround(sqrt(mark.width() * mark.height()))) * GRID_WIDTH;
+            width = width ? width : side;
+            height = height ? height : side;
+        }
+        mark_alignment a = detect_watermark(*bmp, mark, width, height, opt.delta);
+        out << "scale " << setprecision(6) << a.scale << " phase " << a.phase_x << ' ' << a.phase_y << " offset " << a.offset_x << ' ' << a.offset_y
+            << " block " << a.block_x << ' ' << a.block_y << " score " << a.score
+            << " error " << a.error_rate << endl;
+    }
+    else {
+        throw invalid_argument("unknown command " + opt.command);
+    }
+}
+
+// Reads jobs from stdin until EOF; a failed job reports an error and the loop continues
+static int run_batch() {
+    string line;
+    int failed = 0;
+    while (getline(cin, line)) {
+        istringstream words(line);
+        vector<string> args;
+        string word;
+        while (words >> word) {
+            args.push_back(word);
+        }
+        if (args.empty() || args[0][0] == '#') {
+            continue;
+        }
+
+        try {
+            cli_options opt = parse_options(args);
+            if (opt.command == "batch") {
+                throw invalid_argument("batch cannot be nested");
+            }
+            run_command(opt, cout, true);
+        }
+        catch (const exception& e) {
+            cout << "error: " << e.what() << endl;
+            failed++;
+        }
+    }
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+#ifdef _WIN32
+    // Images travel through stdin/stdout, which must not translate line endings
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    ios::sync_with_stdio(false);
+
+    try {
+        cli_options opt = parse_options(vector<string>(argv + 1, argv + argc));
+        if (opt.command == "batch") {
+            return run_batch();
+        }
+        // Results share stdout with the image only when embedding, which prints nothing else
+        run_command(opt, cout, false);
+    }
+    catch (const exception& e) {
+        cerr << "watermark_cli: " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -4,27 +4,80 @@
  * Date: 2024.03.05
  *
  * This header file defines the bitmap_image class for handling BMP images.
- * It provides functionalities to read BMP files, retrieve image dimensions, 
+ * It provides functionalities to read and write BMP files, retrieve image dimensions, 
  * access pixel colors, and display the image and its color table.
+ * 24/32-bit images are kept as a luminance plane in pixel (so the watermark only
+ * touches Y) plus Cb/Cr planes that are passed through unchanged when writing.
  */
 
 #pragma once
-#include <Windows.h>
+#include <cstdint>
+#include <fstream>
+#include <vector>
+
+// On-disk BMP headers, laid out like the Win32 structs of the same name so the
+// library builds without <Windows.h>. BMP stores them little-endian and unaligned.
+#pragma pack(push, 1)
+struct bmp_file_header {
+    uint16_t bfType;      // "BM"
+    uint32_t bfSize;      // File size in bytes
+    uint16_t bfReserved1;
+    uint16_t bfReserved2;
+    uint32_t bfOffBits;   // Offset of the pixel data from the start of the file
+};
+
+struct bmp_info_header {
+    uint32_t biSize;
+    int32_t biWidth;
+    int32_t biHeight;
+    uint16_t biPlanes;
+    uint16_t biBitCount;
+    uint32_t biCompression;
+    uint32_t biSizeImage;
+    int32_t biXPelsPerMeter;
+    int32_t biYPelsPerMeter;
+    uint32_t biClrUsed;
+    uint32_t biClrImportant;
+};
+
+struct bmp_rgb_quad {
+    uint8_t rgbBlue;
+    uint8_t rgbGreen;
+    uint8_t rgbRed;
+    uint8_t rgbReserved;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(bmp_file_header) == 14 && sizeof(bmp_info_header) == 40, "BMP headers must be packed");
 
 class bitmap_image
 {
 protected:
     /* BMP file header and info header */
-    BITMAPFILEHEADER* bf; // Bitmap file header
-    BITMAPINFOHEADER* bi; // Bitmap info header
-    int** pixel;          // 2D array for storing pixel data
+    bmp_file_header bf;                  // Bitmap file header
+    bmp_info_header bi;                  // Bitmap info header
+    std::vector<std::vector<int>> pixel; // Pixel data (luminance for color images)
+    std::vector<char> header;            // Raw bytes before the pixel data, reused when writing
+    std::vector<float> cb;               // Cb plane for 24/32-bit images, row-major
+    std::vector<float> cr;               // Cr plane for 24/32-bit images, row-major
+    std::vector<unsigned char> alpha;    // Alpha plane for 32-bit images, row-major
+
+    // Reads the headers, allocates the image buffers and reads the pixel data
+    void load(std::istream& in);
 
 public:
-    RGBQUAD* pColorTable; // Color table for the image
+    std::vector<bmp_rgb_quad> pColorTable; // Color table for the image
 
     // Constructor that initializes the bitmap_image from a BMP file
     bitmap_image(const char* filename);
-    
+
+    // Constructor that initializes the bitmap_image from a seekable stream (e.g. an in-memory buffer)
+    bitmap_image(std::istream& in);
+
+    // Images are large and never need to be copied
+    bitmap_image(const bitmap_image&) = delete;
+    bitmap_image& operator=(const bitmap_image&) = delete;
+
     // Returns the width of the image
     int width() const;
 
@@ -34,10 +87,26 @@ public:
     // Returns the RGB color of the specified pixel
     int get_pixel(int row, int col) const;
 
+    // Returns the number of bits per pixel
+    int bit_count() const;
+
+    // Returns true for 24/32-bit images
+    bool is_color() const;
+
     // Reads the BMP file and initializes image data
-    void readBmp(const char* filename);
+    void readBmp(std::istream& in);
+
+    // Writes the image to a BMP file with the same format as the source
+    void writeBmp(const char* filename) const;
+
+    // Writes the headers and color table of the image
+    void write_header(std::ostream& out) const;
+
+    // Writes rows [row, row + count) bottom-up, taking luminance from luma (count x width)
+    void write_rows(std::ostream& out, const int row, const int count, const float* luma) const;
 
-    // Displays the entire image from top to bottom and left to right
+    // Displays the entire image from top to bottom and left to right (Windows console only,
+    // defined in bitmap_draw.cpp so the portable library does not link the drawing code)
     void draw_bmp(const int point_x = 0, const int point_y = 0);
 
     // Draws the color table for the image
@@ -0,0 +1,17 @@
+/*
+ * color_convert.h
+ *
+ * This header file declares the RGB <-> YCbCr conversions used for color BMP images.
+ * Pixels are stored interleaved in BMP byte order (B, G, R[, A]); the planes use
+ * full-range BT.601 with Cb and Cr centered at zero.
+ */
+
+#pragma once
+
+// Converts count interleaved BGR(A) pixels into separate Y, Cb and Cr planes
+void bgr_to_ycbcr(const unsigned char* src, const int channels, const int count,
+                  float* y, float* cb, float* cr);
+
+// Converts count Y, Cb and Cr values back into interleaved BGR(A) pixels (alpha is left untouched)
+void ycbcr_to_bgr(const float* y, const float* cb, const float* cr, const int count,
+                  const int channels, unsigned char* dst);
@@ -2,6 +2,7 @@
 
 #include "bitmap_image.h"
 #include <fstream>
+#include <vector>
 
 using namespace std;
 
@@ -9,20 +10,28 @@ using namespace std;
 double matrixSumD(const int X, const int Y, const int i, const int j, const int width);
 double matrixSumF(const int n, const int i, const int j, const int width);
 int W(int n, int N);
+// Sets a custom spreading sequence (empty restores the alternating W(n, N))
+void set_spreading(const vector<double>& sequence);
+vector<double> get_spreading(const int N);
 double C(int u);
 double c(int u);
 void getD(const int x, const int y, const int width);
 void getF(const int n, const int width);
 void DCT(const int width);
 void inverse_DCT(const int width);
+double quantization_delta(const double x, const double delta);
+double quantization_b(const double x, const int b, const double delta);
 void embed_watermark(const bitmap_image& mark, const int M, const double delta);
-void draw_bmp_watermark(const int height, const int width, const int point_x = 0, const int point_y = 0);
+// Runs the inverse DCT strip by strip and saves the result in the format of bmp (8, 24 or 32-bit).
+// The pixel array must still hold bmp; pixels outside the full 8x8 blocks are copied from it.
+void save_bmp_watermark(const bitmap_image& bmp, const char* filename);
+void save_bmp_watermark(const bitmap_image& bmp, ostream& out);
 // Copies the pixel values of the entire image into the pixel array
 void copy_bmp_pixel(const bitmap_image& bmp);
+// Overwrites the pixel array with the inverse-DCT blocks (in-memory round trip, no file)
+void copy_watermark_pixel();
 void clear_pixel();
 void clear_res();
 void add_noise(const double sigma);
 double decode_watermark(const bitmap_image& mark, const int M, const double delta);
-void draw_watermark(const int height, const int width, const int point_x = 0, const int point_y = 0);
-void set_pixel(ofstream& out, char pix);
 double theory_p_e(const double sigma, const double delta);
\ No newline at end of file
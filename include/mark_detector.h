@@ -0,0 +1,34 @@
+/*
+ * mark_detector.h
+ *
+ * This header file declares the detector for suspect images that were cropped (or
+ * upscaled by pixel replication) after embedding, so their 8x8 block grid no longer
+ * starts at (0, 0).
+ * It assumes one mark bit per block (N == K), which is what keeps each block's
+ * projection self-contained and the mark recoverable from any part of the image.
+ */
+
+#pragma once
+
+#include <vector>
+#include "bitmap_image.h"
+
+// Alignment of a suspect image against the original block grid
+struct mark_alignment {
+    double scale;      // Suspect size divided by original size
+    int phase_x;       // Suspect pixels skipped before rescaling (inside a replicated pixel)
+    int phase_y;
+    int offset_x;      // Pixel offset of the block grid in the rescaled suspect
+    int offset_y;
+    int block_x;       // Original block under the first suspect block
+    int block_y;
+    double score;      // Mean lattice score of the block projections, in [-1, 1]
+    double error_rate; // Bit error rate of the decoded mark at this alignment
+};
+
+// Searches scale factors and block-grid offsets for the best alignment of the mark.
+// original_width/height give the size of the image the mark was embedded in;
+// scales lists the coarse scale factors to try (empty uses a default set).
+mark_alignment detect_watermark(const bitmap_image& suspect, const bitmap_image& mark,
+                                const int original_width, const int original_height,
+                                const double delta, const std::vector<double>& scales = std::vector<double>());
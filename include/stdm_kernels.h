@@ -0,0 +1,30 @@
+/*
+ * stdm_kernels.h
+ *
+ * This header file declares the batched STDM embed and decode kernels.
+ * Coefficients are laid out coefficient-major: coefficient j of bit i is coef[j * L + i],
+ * so consecutive bits fill the SIMD lanes. The spreading sequence w has N entries shared
+ * by all bits and may hold any real values (x = <s, w> / <w, w>).
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Projects, quantizes onto the lattice of each bit (0 or 1) and spreads the correction back.
+// The projections before embedding are written to projection when it is not null.
+void stdm_embed(double* coef, const int L, const int N, const double* w, const int* bits,
+                const double delta, double* projection = nullptr);
+
+// Projects each bit's coefficients and decides which dithered lattice is closer
+void stdm_decode(const double* coef, const int L, const int N, const double* w,
+                 const double delta, int* bits);
+
+// Builds a pseudo-random spreading sequence of N standard normal values from a seed.
+// Real values give a continuum of keys; with +-1 entries there would only be 2^N, and
+// w and -w decode each other's marks inverted.
+std::vector<double> random_spreading(const int N, const unsigned long long seed);
+
+// Same, seeded from a 64-bit FNV-1a hash of the key bytes so any string works as a key
+std::vector<double> random_spreading(const int N, const std::string& key);
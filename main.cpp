@@ -10,9 +10,10 @@
 #include <iostream>
 #include <fstream>
 #include <iomanip>
-#include <conio.h>
+#include <cstdlib>
 #include "./include/dct_watermark.h"
 #include "./include/constants.h"
+#include "./include/hdc_graphics.h"
 
 using namespace std;
 
@@ -28,6 +29,7 @@ int main(int argc, char** argv) {
     bitmap_image mark("tj-logo.bmp");
     ofstream out1("result1.txt");
     ofstream out2("result2.txt");
+    const int M = (bmp.height() / GRID_WIDTH) * (bmp.width() / GRID_WIDTH); // Number of 8x8 blocks
 
     for (double delta = 4; delta <= 4; delta += 0.01) {
         for (double sigma = 1.5; sigma <= 1.5; sigma += 0.01) {
@@ -35,23 +37,21 @@ int main(int argc, char** argv) {
             copy_bmp_pixel(bmp);
 
             // Perform DCT transformation
-            DCT(_width);
+            DCT(GRID_WIDTH);
 
             // Embed watermark into the image
             embed_watermark(mark, M, delta);
 
-            // Perform inverse DCT transformation
-            inverse_DCT(_width);
-
-            // Generate the watermarked image
-            draw_bmp_watermark(bmp.height(), bmp.width());
+            // Perform inverse DCT transformation and save the watermarked image (grayscale or color)
+            save_bmp_watermark(bmp, "LENA_tj.bmp");
 
             // Read the pixel values from the watermarked image into an array
             clear_pixel();
-            copy_bmp_pixel(); // Assuming this function takes the new image as input
+            bitmap_image marked("LENA_tj.bmp");
+            copy_bmp_pixel(marked);
 
             // Perform DCT transformation on the watermarked image
-            DCT(_width);
+            DCT(GRID_WIDTH);
 
             // Decode the watermark from the watermarked image
             double res = decode_watermark(mark, M, delta);
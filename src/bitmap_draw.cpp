@@ -0,0 +1,32 @@
+/*
+ * bitmap_draw.cpp
+ *
+ * This file implements the console drawing members of bitmap_image. They need the
+ * Windows GDI, so they live apart from the portable image code in bitmap_image.cpp
+ * and are only linked into the demo application.
+ */
+
+#include <Windows.h>
+#include "../include/bitmap_image.h"
+#include "../include/hdc_graphics.h"
+
+// Displays the entire image from top to bottom and left to right
+void bitmap_image::draw_bmp(const int point_x, const int point_y) {
+    for (int i = 0; i < height(); i++) {
+        for (int j = 0; j < width(); j++) {
+            int rgb = RGB(get_pixel(i, j), get_pixel(i, j), get_pixel(i, j));
+            hdc_set_pencolor(rgb);
+            hdc_base_point(point_x + j, point_y + i);
+        }
+    }
+}
+
+// Draws the color table for the image
+void bitmap_image::draw_pcolortable() {
+    for (int i = 0; i < 256; i++) {
+        for (int j = 0; j < 256; j++) {
+            hdc_set_pencolor(RGB(pColorTable[j].rgbRed, pColorTable[j].rgbGreen, pColorTable[j].rgbBlue));
+            hdc_base_point(j, i);
+        }
+    }
+}
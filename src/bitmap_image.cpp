@@ -4,81 +4,119 @@
  * Date: 2024.03.05
  *
  * This file implements the bitmap_image class for handling BMP images.
- * It provides functionalities to read BMP files, retrieve image dimensions, 
+ * It provides functionalities to read and write BMP files, retrieve image dimensions, 
  * access pixel colors, and display the image and its color table.
  */
 
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
-#include "../include/hdc_graphics.h"
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "../include/bitmap_image.h"
+#include "../include/color_convert.h"
 #include "../include/constants.h"
 
 using namespace std;
 
+// Bytes per stored row (rows are padded to 4 bytes)
+static long long row_stride(const int bit_count, const int width) {
+    return (static_cast<long long>(width) * bit_count + 31) / 32 * 4;
+}
+
 // Constructor that initializes the bitmap_image from a BMP file
 bitmap_image::bitmap_image(const char* filename)
-    : bf(nullptr), bi(nullptr), pColorTable(nullptr), pixel(nullptr)
+    : bf(), bi()
 {
     ifstream in(filename, ios::in | ios::binary);
     if (!in) {
         throw runtime_error("Failed to open the file");
     }
 
-    bf = new(nothrow) BITMAPFILEHEADER;
-    bi = new(nothrow) BITMAPINFOHEADER;
+    load(in);
+}
 
-    if (!bf || !bi) {
-        throw runtime_error("Memory allocation failed for BITMAP headers");
-    }
+// Constructor that initializes the bitmap_image from a seekable stream (e.g. an in-memory buffer)
+bitmap_image::bitmap_image(istream& in)
+    : bf(), bi()
+{
+    load(in);
+}
 
-    in.read(reinterpret_cast<char*>(bf), sizeof(BITMAPFILEHEADER));
-    in.read(reinterpret_cast<char*>(bi), sizeof(BITMAPINFOHEADER));
+// Reads the headers, allocates the image buffers and reads the pixel data.
+// The buffers are containers, so nothing leaks when a malformed image throws.
+void bitmap_image::load(istream& in) {
+    in.read(reinterpret_cast<char*>(&bf), sizeof(bmp_file_header));
+    in.read(reinterpret_cast<char*>(&bi), sizeof(bmp_info_header));
 
-    // Allocate color table based on the bit count
-    int colorTableSize = (bi->biBitCount == 8) ? 256 : 2;
-    pColorTable = new(nothrow) RGBQUAD[colorTableSize];
+    if (!in || bf.bfType != 0x4D42 || bi.biWidth <= 0 || bi.biHeight <= 0) {
+        throw runtime_error("Input is not a supported BMP image");
+    }
+    if (bi.biBitCount != 1 && bi.biBitCount != 8 && !is_color()) {
+        throw runtime_error("Unsupported bit count for BMP image");
+    }
 
-    if (!pColorTable) {
-        throw runtime_error("Memory allocation failed for color table");
+    // The pixel data must start after the headers and color table and fit in the input
+    int colorTableSize = (bi.biBitCount == 8) ? 256 : (bi.biBitCount == 1) ? 2 : 0;
+    in.seekg(0, ios::end);
+    const long long length = in.tellg();
+    const long long first = sizeof(bmp_file_header) + sizeof(bmp_info_header) + colorTableSize * sizeof(bmp_rgb_quad);
+    if (length < 0 || bf.bfOffBits < first || bf.bfOffBits > length) {
+        throw runtime_error("BMP pixel data offset is out of range");
+    }
+    if (length - bf.bfOffBits < row_stride(bi.biBitCount, bi.biWidth) * bi.biHeight) {
+        throw runtime_error("BMP pixel data is truncated");
     }
 
-    in.read(reinterpret_cast<char*>(pColorTable), colorTableSize * sizeof(RGBQUAD));
+    // Read the color table based on the bit count (24/32-bit images have none)
+    if (colorTableSize) {
+        pColorTable.resize(colorTableSize);
+        in.seekg(sizeof(bmp_file_header) + sizeof(bmp_info_header), ios::beg);
+        in.read(reinterpret_cast<char*>(pColorTable.data()), colorTableSize * sizeof(bmp_rgb_quad));
+    }
 
-    // Allocate memory for pixel data
-    pixel = new(nothrow) int*[bi->biHeight];
-    if (!pixel) {
-        throw runtime_error("Memory allocation failed for pixel array");
+    // Keep everything before the pixel data so the image can be written back as-is
+    header.resize(bf.bfOffBits);
+    in.seekg(0, ios::beg);
+    in.read(header.data(), bf.bfOffBits);
+    if (!in) {
+        throw runtime_error("Failed to read the BMP header");
     }
-    for (int i = 0; i < bi->biHeight; ++i) {
-        pixel[i] = new(nothrow) int[bi->biWidth];
-        if (!pixel[i]) {
-            throw runtime_error("Memory allocation failed for pixel row");
+
+    pixel.assign(bi.biHeight, vector<int>(bi.biWidth));
+
+    // Chroma (and alpha) planes for color images
+    if (is_color()) {
+        const size_t size = static_cast<size_t>(bi.biWidth) * bi.biHeight;
+        cb.resize(size);
+        cr.resize(size);
+        if (bi.biBitCount == 32) {
+            alpha.resize(size);
         }
     }
 
     readBmp(in);
 }
 
-// Destructor to free allocated memory
-bitmap_image::~bitmap_image() {
-    delete[] pColorTable;
-    for (int i = 0; i < bi->biHeight; ++i) {
-        delete[] pixel[i];
-    }
-    delete[] pixel;
-    delete bf;
-    delete bi;
-}
-
 // Returns the height of the image
 int bitmap_image::height() const {
-    return bi->biHeight;
+    return bi.biHeight;
 }
 
 // Returns the width of the image
 int bitmap_image::width() const {
-    return bi->biWidth;
+    return bi.biWidth;
+}
+
+// Returns the number of bits per pixel
+int bitmap_image::bit_count() const {
+    return bi.biBitCount;
+}
+
+// Returns true for 24/32-bit images
+bool bitmap_image::is_color() const {
+    return bi.biBitCount == 24 || bi.biBitCount == 32;
 }
 
 // Returns the RGB color of the specified pixel
@@ -90,55 +128,138 @@ int bitmap_image::get_pixel(int row, int col) const {
 }
 
 // Reads the BMP file and initializes pixel data
-void bitmap_image::readBmp(ifstream& in) {
-    in.seekg(bf->bfOffBits, ios::beg);
-    switch (bi->biBitCount) {
+void bitmap_image::readBmp(istream& in) {
+    in.seekg(bf.bfOffBits, ios::beg);
+    switch (bi.biBitCount) {
         case 1:
-            for (int i = 0; i < bi->biHeight; ++i) {
+            for (int i = 0; i < bi.biHeight; ++i) {
+                // Skip the padding left after the previous row
+                if (i) {
+                    in.seekg(row_stride(1, bi.biWidth) - bi.biWidth / 8, ios::cur);
+                }
                 unsigned char byte;
-                for (int j = 0; j < bi->biWidth / 8; ++j) {
+                for (int j = 0; j < bi.biWidth / 8; ++j) {
                     byte = in.get();
                     for (int k = 0; k < 8; ++k) {
                         int pix = (byte & 0x80) ? 1 : -1; // 0 is black, 1 is white
-                        pixel[bi->biHeight - i - 1][j * 8 + k] = pix;
+                        pixel[bi.biHeight - i - 1][j * 8 + k] = pix;
                         byte <<= 1; // Shift left for the next pixel
                     }
                 }
             }
             break;
         case 8:
-            for (int i = 0; i < bi->biHeight; ++i) {
-                for (int j = 0; j < bi->biWidth; ++j) {
+            for (int i = 0; i < bi.biHeight; ++i) {
+                for (int j = 0; j < bi.biWidth; ++j) {
                     int color = in.get();
-                    pixel[bi->biHeight - i - 1][j] = color;
+                    pixel[bi.biHeight - i - 1][j] = color;
                 }
                 // Padding for rows
-                if (bi->biWidth % 4 != 0) {
-                    in.seekg(4 - (bi->biWidth % 4), ios::cur);
+                if (bi.biWidth % 4 != 0) {
+                    in.seekg(4 - (bi.biWidth % 4), ios::cur);
+                }
+            }
+            break;
+        case 24:
+        case 32: {
+            // Read one strip of GRID_WIDTH rows at a time and convert it to YCbCr while it is hot.
+            // Unlike the write side, the forward DCT is not fused here: Y is rounded into pixel
+            // like 8-bit data and transformed later by copy_bmp_pixel + DCT (costs <= 0.5 of luma).
+            const int channels = bi.biBitCount / 8;
+            const int stride = (bi.biWidth * channels + 3) & ~3;
+            vector<unsigned char> strip(GRID_WIDTH * stride);
+            vector<float> luma(bi.biWidth);
+
+            for (int i = 0; i < bi.biHeight; i += GRID_WIDTH) {
+                const int rows = min(GRID_WIDTH, bi.biHeight - i);
+                in.read(reinterpret_cast<char*>(strip.data()), rows * stride);
+                if (!in) {
+                    break;
+                }
+
+                for (int k = 0; k < rows; ++k) {
+                    const int row = bi.biHeight - (i + k) - 1;
+                    const unsigned char* src = strip.data() + k * stride;
+                    const int offset = row * bi.biWidth;
+
+                    bgr_to_ycbcr(src, channels, bi.biWidth, luma.data(), cb.data() + offset, cr.data() + offset);
+                    for (int j = 0; j < bi.biWidth; ++j) {
+                        pixel[row][j] = static_cast<int>(lround(luma[j]));
+                    }
+                    if (!alpha.empty()) {
+                        for (int j = 0; j < bi.biWidth; ++j) {
+                            alpha[offset + j] = src[j * channels + 3];
+                        }
+                    }
                 }
             }
             break;
+        }
         default:
             throw runtime_error("Unsupported bit count for BMP image");
     }
+
+    // A short read leaves stale data in the image, so never hand it on
+    if (!in) {
+        throw runtime_error("BMP pixel data is truncated");
+    }
 }
 
-// Displays the entire image from top to bottom and left to right
-void bitmap_image::draw_bmp(const int point_x, const int point_y) {
-    for (int i = 0; i < height(); i++) {
-        for (int j = 0; j < width(); j++) {
-            int rgb = RGB(get_pixel(i, j), get_pixel(i, j), get_pixel(i, j));
-            hdc_set_pencolor(rgb);
-            hdc_base_point(point_x + j, point_y + i);
+// Writes the image to a BMP file with the same format as the source
+void bitmap_image::writeBmp(const char* filename) const {
+    ofstream out(filename, ios::out | ios::binary);
+    if (!out) {
+        throw runtime_error("Failed to open the output file");
+    }
+
+    write_header(out);
+
+    vector<float> luma(GRID_WIDTH * bi.biWidth);
+    for (int i = (bi.biHeight - 1) / GRID_WIDTH * GRID_WIDTH; i >= 0; i -= GRID_WIDTH) {
+        const int rows = min(GRID_WIDTH, bi.biHeight - i);
+        for (int k = 0; k < rows; ++k) {
+            for (int j = 0; j < bi.biWidth; ++j) {
+                luma[k * bi.biWidth + j] = static_cast<float>(pixel[i + k][j]);
+            }
         }
+        write_rows(out, i, rows, luma.data());
     }
 }
 
-// Draws the color table for the image
-void bitmap_image::draw_pcolortable() {
-    for (int i = 0; i < 256; i++) {
-        for (int j = 0; j < 256; j++) {
-            hdc_set_pencolor(RGB(pColorTable[j].rgbRed, pColorTable[j].rgbGreen, pColorTable[j].rgbBlue));
-            hdc_base_point(j, i);
+// Writes the headers and color table of the image
+void bitmap_image::write_header(ostream& out) const {
+    out.write(header.data(), header.size());
+}
+
+// Writes rows [row, row + count) bottom-up, taking luminance from luma (count x width)
+void bitmap_image::write_rows(ostream& out, const int row, const int count, const float* luma) const {
+    const int channels = max(bi.biBitCount / 8, 1);
+    const int stride = (bi.biWidth * channels + 3) & ~3;
+    vector<unsigned char> line(stride, 0);
+
+    for (int k = count - 1; k >= 0; --k) {
+        const float* y = luma + k * bi.biWidth;
+        const int offset = (row + k) * bi.biWidth;
+
+        switch (bi.biBitCount) {
+            case 8:
+                for (int j = 0; j < bi.biWidth; ++j) {
+                    line[j] = static_cast<unsigned char>(min(max(static_cast<int>(lround(y[j])), 0), 255));
+                }
+                break;
+            case 24:
+            case 32:
+                // Chroma is passed through; only the luminance comes from the caller
+                ycbcr_to_bgr(y, cb.data() + offset, cr.data() + offset, bi.biWidth, channels, line.data());
+                if (!alpha.empty()) {
+                    for (int j = 0; j < bi.biWidth; ++j) {
+                        line[j * channels + 3] = alpha[offset + j];
+                    }
+                }
+                break;
+            default:
+                throw runtime_error("Unsupported bit count for BMP output");
         }
+        out.write(reinterpret_cast<const char*>(line.data()), stride);
     }
+}
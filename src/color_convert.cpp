@@ -0,0 +1,93 @@
+/*
+ * color_convert.cpp
+ *
+ * This file implements the RGB <-> YCbCr conversions for color BMP images.
+ * Four pixels are converted per step with SSE; the remaining pixels of a row
+ * fall back to the scalar formulas.
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <emmintrin.h>
+#include "../include/color_convert.h"
+
+using namespace std;
+
+// Full-range BT.601 coefficients
+const float KR = 0.299f, KG = 0.587f, KB = 0.114f;
+const float CB_R = -0.168736f, CB_G = -0.331264f, CB_B = 0.5f;
+const float CR_R = 0.5f, CR_G = -0.418688f, CR_B = -0.081312f;
+const float R_CR = 1.402f, G_CB = -0.344136f, G_CR = -0.714136f, B_CB = 1.772f;
+
+// Rounds and clamps a channel value into a byte, with the same round-half-to-even
+// conversion as _mm_cvtps_epi32 so the scalar tail matches the SIMD lanes
+static unsigned char to_byte(const float v) {
+    return static_cast<unsigned char>(min(max(_mm_cvtss_si32(_mm_set_ss(v)), 0), 255));
+}
+
+void bgr_to_ycbcr(const unsigned char* src, const int channels, const int count,
+                  float* y, float* cb, float* cr) {
+    const __m128 kr = _mm_set1_ps(KR), kg = _mm_set1_ps(KG), kb = _mm_set1_ps(KB);
+    const __m128 cbr = _mm_set1_ps(CB_R), cbg = _mm_set1_ps(CB_G), cbb = _mm_set1_ps(CB_B);
+    const __m128 crr = _mm_set1_ps(CR_R), crg = _mm_set1_ps(CR_G), crb = _mm_set1_ps(CR_B);
+
+    int n = 0;
+    for (; n + 4 <= count; n += 4) {
+        const unsigned char* p = src + n * channels;
+        // Deinterleave four pixels into one register per channel
+        __m128 b = _mm_setr_ps(p[0], p[channels], p[2 * channels], p[3 * channels]);
+        __m128 g = _mm_setr_ps(p[1], p[channels + 1], p[2 * channels + 1], p[3 * channels + 1]);
+        __m128 r = _mm_setr_ps(p[2], p[channels + 2], p[2 * channels + 2], p[3 * channels + 2]);
+
+        __m128 vy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(kr, r), _mm_mul_ps(kg, g)), _mm_mul_ps(kb, b));
+        __m128 vcb = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cbr, r), _mm_mul_ps(cbg, g)), _mm_mul_ps(cbb, b));
+        __m128 vcr = _mm_add_ps(_mm_add_ps(_mm_mul_ps(crr, r), _mm_mul_ps(crg, g)), _mm_mul_ps(crb, b));
+
+        _mm_storeu_ps(y + n, vy);
+        _mm_storeu_ps(cb + n, vcb);
+        _mm_storeu_ps(cr + n, vcr);
+    }
+    for (; n < count; n++) {
+        const unsigned char* p = src + n * channels;
+        y[n] = KR * p[2] + KG * p[1] + KB * p[0];
+        cb[n] = CB_R * p[2] + CB_G * p[1] + CB_B * p[0];
+        cr[n] = CR_R * p[2] + CR_G * p[1] + CR_B * p[0];
+    }
+}
+
+void ycbcr_to_bgr(const float* y, const float* cb, const float* cr, const int count,
+                  const int channels, unsigned char* dst) {
+    const __m128 rcr = _mm_set1_ps(R_CR), gcb = _mm_set1_ps(G_CB);
+    const __m128 gcr = _mm_set1_ps(G_CR), bcb = _mm_set1_ps(B_CB);
+
+    int n = 0;
+    for (; n + 4 <= count; n += 4) {
+        __m128 vy = _mm_loadu_ps(y + n);
+        __m128 vcb = _mm_loadu_ps(cb + n);
+        __m128 vcr = _mm_loadu_ps(cr + n);
+
+        // Round to int32, then saturate down to unsigned bytes
+        __m128i r = _mm_cvtps_epi32(_mm_add_ps(vy, _mm_mul_ps(rcr, vcr)));
+        __m128i g = _mm_cvtps_epi32(_mm_add_ps(vy, _mm_add_ps(_mm_mul_ps(gcb, vcb), _mm_mul_ps(gcr, vcr))));
+        __m128i b = _mm_cvtps_epi32(_mm_add_ps(vy, _mm_mul_ps(bcb, vcb)));
+        __m128i rg = _mm_packus_epi16(_mm_packs_epi32(r, g), _mm_setzero_si128());
+        __m128i bz = _mm_packus_epi16(_mm_packs_epi32(b, b), _mm_setzero_si128());
+
+        alignas(16) unsigned char rgb[16], bb[16];
+        _mm_store_si128(reinterpret_cast<__m128i*>(rgb), rg);
+        _mm_store_si128(reinterpret_cast<__m128i*>(bb), bz);
+
+        unsigned char* p = dst + n * channels;
+        for (int k = 0; k < 4; k++) {
+            p[k * channels] = bb[k];
+            p[k * channels + 1] = rgb[4 + k];
+            p[k * channels + 2] = rgb[k];
+        }
+    }
+    for (; n < count; n++) {
+        unsigned char* p = dst + n * channels;
+        p[0] = to_byte(y[n] + B_CB * cb[n]);
+        p[1] = to_byte(y[n] + (G_CB * cb[n] + G_CR * cr[n]));
+        p[2] = to_byte(y[n] + R_CR * cr[n]);
+    }
+}
@@ -8,10 +8,15 @@
 */
 
 #include <vector>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <random>
+#include <stdexcept>
+#include <fstream>
+#include "../include/dct_watermark.h"
+#include "../include/stdm_kernels.h"
 #include "../include/constants.h"
-#include "../include/hdc_graphics.h"
 
 using namespace std;
 
@@ -23,8 +28,10 @@ uniform_real_distribution<> distr(LOWER_BOUND, UPPER_BOUND);
 
 double D[4096][8][8];
 double F[4096][8][8];
+int block_cols = 0; // Blocks per row of the grid held in D and F, set by DCT
 vector<vector<int>> pixel;
 vector<int> res;
+vector<double> spreading;
 
 // Function to compute the DCT matrix sum
 double matrixSumD(const int X, const int Y, const int i, const int j, const int width) {
@@ -47,7 +54,7 @@ double C(int u) {
 void getD(const int x, const int y, const int width) {
     for (int j = 0; j < width; j++) {
         for (int i = 0; i < width; i++) {
-            D[x + y * pixel.size() / width][i][j] = 
+            D[x + y * block_cols][i][j] = 
                 1 / sqrt(2 * width) * C(i) * C(j) * matrixSumD(x * width, y * width, i, j, width);
         }
     }
@@ -58,6 +65,26 @@ int W(int n, int N) {
     return (n % 2) ? 1 : -1;
 }
 
+// Use a custom spreading sequence instead of the alternating W(n, N); empty restores the default
+void set_spreading(const vector<double>& sequence) {
+    spreading = sequence;
+}
+
+// Returns the spreading sequence for N coefficients per bit
+vector<double> get_spreading(const int N) {
+    if (spreading.empty()) {
+        vector<double> w(N);
+        for (int j = 0; j < N; j++) {
+            w[j] = W(j, N);
+        }
+        return w;
+    }
+    if (static_cast<int>(spreading.size()) != N) {
+        throw invalid_argument("Spreading sequence length does not match the coefficients per bit");
+    }
+    return spreading;
+}
+
 // Function to compute normalization coefficient for inverse DCT
 double c(int u) {
     return (u == 0) ? 1 : sqrt(2);
@@ -88,8 +115,14 @@ void getF(const int n, const int width) {
 
 // Perform the DCT on the image
 void DCT(const int width) {
-    for (int i = 0; i < 64; i++) {
-        for (int j = 0; j < 64; j++) {
+    const int rows = pixel.size() / width;
+    const int cols = pixel[0].size() / width;
+    if (rows * cols > MAX_PIXELS) {
+        throw runtime_error("Image has more blocks than the coefficient buffers hold");
+    }
+    block_cols = cols;
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
             getD(j, i, width);
         }
     }
@@ -97,9 +130,10 @@ void DCT(const int width) {
 
 // Perform the inverse DCT on the image
 void inverse_DCT(const int width) {
-    for (int i = 0; i < _bmp_height / width; i++) {
-        for (int j = 0; j < _bmp_width / width; j++) {
-            getF(i * _bmp_height / width + j, width);
+    const int rows = pixel.size() / width;
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < block_cols; j++) {
+            getF(i * block_cols + j, width);
         }
     }
 }
@@ -115,13 +149,15 @@ double quantization_b(const double x, const int b, const double delta) {
 }
 
 // Function to embed a watermark into the image
-void embed_watermark(bitmap_image mark, const int M, const double delta) {
+void embed_watermark(const bitmap_image& mark, const int M, const double delta) {
     const int K = 8;
     const int L = mark.height() * mark.width();
     const int N = M * K / L;
+    if (L > M * K) {
+        throw runtime_error("Mark larger than image capacity");
+    }
     double** s = new double*[K * M];
 
-    vector<double> x_projection(M, 0);
     int count = 0;
 
     // Prepare DCT coefficients for watermark embedding
@@ -134,57 +170,98 @@ void embed_watermark(bitmap_image mark, const int M, const double delta) {
         s[count++] = &D[i][2][5];
         s[count++] = &D[i][1][6];
         s[count++] = &D[i][0][7];
+    }
 
-        // Compute x_projection for watermarking
-        for (int j = 0; j < K; j++) {
-            x_projection[i] += D[i][7 - j][j] * W(j, N);
+    // Gather coefficient-major so the kernel handles consecutive bits in one register
+    vector<double> coef(N * L);
+    vector<int> bits(L);
+    for (int i = 0; i < L; i++) {
+        bits[i] = (mark.get_pixel(i / mark.width(), i % mark.width()) == 1) ? 1 : 0;
+        for (int j = 0; j < N; j++) {
+            coef[j * L + i] = *s[i * N + j];
         }
-        x_projection[i] /= N;
     }
 
-    count = 0;
+    const vector<double> w = get_spreading(N);
+    stdm_embed(coef.data(), L, N, w.data(), bits.data(), delta, nullptr);
+
     for (int i = 0; i < L; i++) {
         for (int j = 0; j < N; j++) {
-            int b = mark.get_pixel(i / mark.width(), i % mark.width());
-            *s[count] += (quantization_b(x_projection[i], b, delta) - x_projection[i]) * W(j, N);
-            count++;
+            *s[i * N + j] = coef[j * L + i];
         }
     }
     delete[] s; // Free dynamically allocated memory
 }
 
-// Function to draw the watermarked image
-void draw_bmp_watermark(const int height, const int width, const int point_x, const int point_y) {
-    BITMAPFILEHEADER* bf = new BITMAPFILEHEADER;
-    ifstream in("LENA.bmp", ios::binary);
-    ofstream out("LENA_tj.bmp", ios::binary);
+// Save the watermarked image, running the inverse DCT one strip of blocks at a time.
+// Each strip is written as soon as it is reconstructed, so color images only add the
+// YCbCr -> RGB pass on data that is still in cache.
+void save_bmp_watermark(const bitmap_image& bmp, const char* filename) {
+    ofstream out(filename, ios::binary);
+    if (!out) {
+        throw runtime_error("Failed to open the output file");
+    }
+    save_bmp_watermark(bmp, out);
+    out.close();
+    cout << "Watermarked image saved as " << filename << endl;
+}
+
+// Stream variant of save_bmp_watermark, used to write to stdout or memory
+void save_bmp_watermark(const bitmap_image& bmp, ostream& out) {
+    const int width = bmp.width();
+    const int block_rows = bmp.height() / GRID_WIDTH;
+    const int marked_width = block_cols * GRID_WIDTH;
+    if (static_cast<int>(pixel.size()) != bmp.height()) {
+        throw runtime_error("The pixel array does not hold this image");
+    }
+    bmp.write_header(out);
 
-    in.read((char*)bf, sizeof(BITMAPFILEHEADER));
-    in.seekg(0, ios::beg);
+    vector<float> strip(GRID_WIDTH * width);
 
-    char* header = new char[bf->bfOffBits];
-    in.read(header, bf->bfOffBits);
-    out.write(header, bf->bfOffBits);
-    delete[] header;
+    // Rows below the last full strip and columns right of the last full block are not
+    // covered by any block, so they keep their unmarked values from the pixel array
+    const int tail = bmp.height() - block_rows * GRID_WIDTH;
+    if (tail) {
+        for (int i = 0; i < tail; i++) {
+            for (int j = 0; j < width; j++) {
+                strip[i * width + j] = static_cast<float>(pixel[block_rows * GRID_WIDTH + i][j]);
+            }
+        }
+        bmp.write_rows(out, block_rows * GRID_WIDTH, tail, strip.data());
+    }
 
-    for (int i = height - 1; i >= 0; i--) {
-        for (int j = 0; j < width; j++) {
-            int color = static_cast<int>(round(F[i / 8 * 64 + j / 8][j % 8][i % 8]));
-            set_pixel(out, (char)color);
+    // BMP rows are stored bottom-up, so start from the last strip
+    for (int y = block_rows - 1; y >= 0; y--) {
+        for (int x = 0; x < block_cols; x++) {
+            getF(y * block_cols + x, GRID_WIDTH);
         }
+        for (int i = 0; i < GRID_WIDTH; i++) {
+            for (int j = 0; j < marked_width; j++) {
+                strip[i * width + j] = static_cast<float>(F[y * block_cols + j / GRID_WIDTH][j % GRID_WIDTH][i]);
+            }
+            for (int j = marked_width; j < width; j++) {
+                strip[i * width + j] = static_cast<float>(pixel[y * GRID_WIDTH + i][j]);
+            }
+        }
+        bmp.write_rows(out, y * GRID_WIDTH, GRID_WIDTH, strip.data());
     }
-    in.close();
-    out.close();
-    cout << "Watermarked image saved as LENA_tj.bmp" << endl;
 }
 
-// Function to set a pixel value in the output bitmap
-void set_pixel(ofstream& out, char pix) {
-    out << pix;
+// Overwrite the pixel array with the reconstructed blocks, rounded as they would be when saved.
+// Pixels outside the full 8x8 blocks keep their unmarked values, as in save_bmp_watermark.
+void copy_watermark_pixel() {
+    const int rows = pixel.size() / GRID_WIDTH * GRID_WIDTH;
+    const int cols = block_cols * GRID_WIDTH;
+    for (int i = 0; i < rows; i++) {
+        for (int j = 0; j < cols; j++) {
+            double v = F[i / GRID_WIDTH * block_cols + j / GRID_WIDTH][j % GRID_WIDTH][i % GRID_WIDTH];
+            pixel[i][j] = static_cast<int>(round(min(max(v, 0.0), 255.0)));
+        }
+    }
 }
 
 // Copy pixel data from the bitmap image
-void copy_bmp_pixel(bitmap_image bmp) {
+void copy_bmp_pixel(const bitmap_image& bmp) {
     for (int i = 0; i < bmp.height(); i++) {
         vector<int> tmp;
         for (int j = 0; j < bmp.width(); j++) {
@@ -195,7 +272,7 @@ void copy_bmp_pixel(bitmap_image bmp) {
 }
 
 // Function to compute the pixel comparison
-double comp_pixel(bitmap_image mark) {
+double comp_pixel(const bitmap_image& mark) {
     int sum = 0;
     int count = 0;
 
@@ -210,10 +287,13 @@ double comp_pixel(bitmap_image mark) {
 }
 
 // Decode the watermark from the image
-double decode_watermark(bitmap_image mark, const int M, const double delta) {
+double decode_watermark(const bitmap_image& mark, const int M, const double delta) {
     const int K = 8;
     const int L = mark.height() * mark.width();
     const int N = M * K / L;
+    if (L > M * K) {
+        throw runtime_error("Mark larger than image capacity");
+    }
     double* S = new double[K * M];
 
     int count = 0;
@@ -229,15 +309,18 @@ double decode_watermark(bitmap_image mark, const int M, const double delta) {
         S[count++] = D[i][0][7];
     }
     
-    count = 0;
+    // Project each group of N coefficients and pick the bit whose dithered lattice is closer
+    vector<double> coef(N * L);
     for (int i = 0; i < L; i++) {
         for (int j = 0; j < N; j++) {
-            double s = S[count];
-            int b = mark.get_pixel(i / mark.width(), i % mark.width());
-            res[count++] = (s < quantization_b(x_projection[i], b, delta) - x_projection[i]) ? 1 : 0;
+            coef[j * L + i] = S[i * N + j];
         }
     }
 
+    const vector<double> w = get_spreading(N);
+    res.assign(L, 0);
+    stdm_decode(coef.data(), L, N, w.data(), delta, res.data());
+
     delete[] S; // Free dynamically allocated memory
     return comp_pixel(mark);
 }
@@ -252,9 +335,9 @@ void clear_res() {
 
 void add_noise(double sigma) {
 	double noise;
-	for (int i = 0; i < 4096; i++) {
-		for (int j = 0; j < _width; j++)
-			for (int k = 0; k < _width; k++) {
+	for (int i = 0; i < MAX_PIXELS; i++) {
+		for (int j = 0; j < GRID_WIDTH; j++)
+			for (int k = 0; k < GRID_WIDTH; k++) {
 				double ran1 = distr(gen);
 				double ran2 = distr(gen);
 				noise = sqrt(-2 * log(1 - ran1)) * sin(2 * PI * ran2) * sigma;
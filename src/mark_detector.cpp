@@ -0,0 +1,435 @@
+/*
+ * mark_detector.cpp
+ *
+ * Functionality: This source file implements the alignment search for cropped or rescaled
+ * suspect images. Candidate scales are resampled from a precomputed image pyramid, and
+ * candidate block-grid offsets are scored by how close each block's projection lies to
+ * the dithered quantization lattices. The search runs coarse to fine: every scale, sub-pixel
+ * phase and offset is first scored on a small window in the middle of the image, and only
+ * the best candidates, their scale neighbours and their adjacent offsets are rescored on
+ * windows that double in size while the scale step halves. Windows are resampled and
+ * transformed one strip of blocks at a time: the row DCT runs only at the column phases
+ * being scored and is shared by every candidate with that phase, and only the 8
+ * anti-diagonal coefficients are ever finished per block, so beyond the pyramid memory
+ * stays at a few strips.
+ *
+ * Crops at any pixel offset, and crops of integer pixel-replicating upscales within the
+ * scale range (2x by default), are recovered exactly. Other rescales, and any interpolating
+ * resize, change the gain of the high-frequency coefficients the mark lives in; STDM
+ * lattices do not survive that on textured images, so the scale search usually cannot
+ * recover them.
+ */
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include "../include/mark_detector.h"
+#include "../include/dct_watermark.h"
+#include "../include/constants.h"
+
+using namespace std;
+
+const int K = GRID_WIDTH;            // Coefficients per block, one mark bit per block
+const int FIRST_WINDOW = 8 * K;      // Side of the first search window in pixels
+const int KEEP = 8;                  // Candidates kept between refinement stages
+const double MIN_SCALE = 0.5;        // Default scale range and relative step
+const double MAX_SCALE = 2.0;
+const double SCALE_STEP = 0.01;
+
+// A luminance plane, row-major
+struct luma_plane {
+    int width = 0;
+    int height = 0;
+    vector<float> data;
+};
+
+// An alignment candidate
+struct candidate {
+    double scale;
+    int phase_x;    // Shift in suspect pixels, below the scale, for integer upscales
+    int phase_y;
+    int offset_x;   // Block-grid offset in the rescaled suspect
+    int offset_y;
+    double score;
+};
+
+static double basis[K][K];  // basis[k][n] = cos((2n + 1)k PI / 2K)
+static double weight[K];    // Weight of coefficient D[K-1-j][j] in the projection
+
+// Fill the cosine basis and projection weights for the current spreading sequence
+static void init_tables() {
+    for (int k = 0; k < K; k++) {
+        for (int n = 0; n < K; n++) {
+            basis[k][n] = cos((2 * n + 1) * k * PI / (2 * K));
+        }
+    }
+    const vector<double> w = get_spreading(K);
+    double norm = 0;
+    for (int j = 0; j < K; j++) {
+        norm += w[j] * w[j];
+    }
+    for (int j = 0; j < K; j++) {
+        weight[j] = 1 / sqrt(2 * K) * C(K - 1 - j) * C(j) * w[j] / norm;
+    }
+}
+
+// Build the pyramid: level 0 is the suspect luminance, each level halves the previous one
+static vector<luma_plane> build_pyramid(const bitmap_image& bmp) {
+    vector<luma_plane> levels(1);
+    luma_plane& base = levels[0];
+    base.width = bmp.width();
+    base.height = bmp.height();
+    base.data.resize(base.width * base.height);
+    for (int i = 0; i < base.height; i++) {
+        for (int j = 0; j < base.width; j++) {
+            base.data[i * base.width + j] = static_cast<float>(bmp.get_pixel(i, j));
+        }
+    }
+
+    while (levels.back().width >= 4 * K && levels.back().height >= 4 * K) {
+        const luma_plane& prev = levels.back();
+        luma_plane next;
+        next.width = prev.width / 2;
+        next.height = prev.height / 2;
+        next.data.resize(next.width * next.height);
+        for (int i = 0; i < next.height; i++) {
+            for (int j = 0; j < next.width; j++) {
+                const float* p = &prev.data[2 * i * prev.width + 2 * j];
+                next.data[i * next.width + j] = (p[0] + p[1] + p[prev.width] + p[prev.width + 1]) / 4;
+            }
+        }
+        levels.push_back(next);
+    }
+    return levels;
+}
+
+
+// Number of whole suspect-pixel phases to try at a scale. An upscale by s replicates each
+// pixel s times, and a crop can start anywhere inside those runs, which whole-pixel offsets
+// of the rescaled grid cannot express.
+static int phase_count(const double scale) {
+    return max(static_cast<int>(floor(scale + 1e-9)), 1);
+}
+
+// Size of the suspect once shifted by the phase and scaled back to the original resolution
+static void scaled_size(const vector<luma_plane>& pyramid, const double scale, const int phase_x, const int phase_y,
+                        int& width, int& height) {
+    width = static_cast<int>((pyramid[0].width - phase_x) / scale);
+    height = static_cast<int>((pyramid[0].height - phase_y) / scale);
+}
+
+// Resample rows [y0, y0 + count) and columns [x0, x0 + width) of the suspect scaled back by 1 / scale
+// and shifted by the phase into out. The coarsest pyramid level not coarser than the target keeps
+// downscaling anti-aliased, as long as its cells do not straddle the phase.
+static void resample(const vector<luma_plane>& pyramid, const double scale, const int phase_x, const int phase_y,
+                     const int x0, const int y0, const int width, const int count, float* out) {
+    int level = 0;
+    while (level + 1 < static_cast<int>(pyramid.size()) && (1 << (level + 1)) <= scale &&
+           phase_x % (1 << (level + 1)) == 0 && phase_y % (1 << (level + 1)) == 0) {
+        level++;
+    }
+    const luma_plane& src = pyramid[level];
+    const double unit = 1 << level;
+
+    for (int i = 0; i < count; i++) {
+        double sy = min(max(((y0 + i + 0.5) * scale + phase_y) / unit - 0.5, 0.0), src.height - 1.0);
+        int y = min(static_cast<int>(sy), src.height - 2);
+        double fy = sy - y;
+        for (int j = 0; j < width; j++) {
+            double sx = min(max(((x0 + j + 0.5) * scale + phase_x) / unit - 0.5, 0.0), src.width - 1.0);
+            int x = min(static_cast<int>(sx), src.width - 2);
+            double fx = sx - x;
+            const float* p = &src.data[y * src.width + x];
+            out[i * width + j] = static_cast<float>(
+                (p[0] * (1 - fx) + p[1] * fx) * (1 - fy) + (p[src.width] * (1 - fx) + p[src.width + 1] * fx) * fy);
+        }
+    }
+}
+
+// Row DCT at one column phase for rows [first, plane.height): rows[(u * stride + y) * blocks + b]
+// holds frequency u of the K pixels of row y that start at ox + b K. Returns the blocks per row.
+static int row_dct(const luma_plane& plane, const int ox, const int first, const int stride, vector<float>& rows) {
+    const int blocks = (plane.width - ox) / K;
+    rows.resize(static_cast<size_t>(K) * stride * blocks);
+    for (int u = 0; u < K; u++) {
+        for (int y = first; y < plane.height; y++) {
+            const float* p = &plane.data[y * plane.width + ox];
+            float* r = &rows[(static_cast<size_t>(u) * stride + y) * blocks];
+            for (int b = 0; b < blocks; b++) {
+                double sum = 0;
+                for (int n = 0; n < K; n++) {
+                    sum += p[b * K + n] * basis[u][n];
+                }
+                r[b] = static_cast<float>(sum);
+            }
+        }
+    }
+    return blocks;
+}
+
+// Finish the column pass for the anti-diagonal only and project it like embed_watermark does
+static double block_projection(const vector<float>& rows, const int blocks, const int stride,
+                               const int b, const int Y) {
+    double y = 0;
+    for (int j = 0; j < K; j++) {
+        const float* r = &rows[(static_cast<size_t>(K - 1 - j) * stride + Y) * blocks + b];
+        double sum = 0;
+        for (int n = 0; n < K; n++) {
+            sum += r[n * blocks] * basis[j][n];
+        }
+        y += sum * weight[j];
+    }
+    return y;
+}
+
+// 1 when the projection sits on one of the two dithered lattices (delta/4 + k delta/2), -1 halfway between
+static double lattice_score(const double y, const double delta) {
+    return cos(4 * PI * (y - delta / 4) / delta);
+}
+
+// Score candidates that share one scale and phase on the ww x wh window at (x0, y0) of the
+// rescaled suspect: each score becomes the mean lattice score of the candidate's blocks.
+// The window is resampled as strips of 2K rows that advance by K (so strip t holds block row t
+// for every offset_y). Each column phase in use keeps its row DCT across strips, so every
+// resampled row is transformed once per phase.
+// When projections is not null it receives the first candidate's block projections row by row.
+static void score_candidates(const vector<luma_plane>& pyramid, vector<candidate>& group,
+                             const int x0, const int y0, const int ww, const int wh, const double delta,
+                             vector<double>* projections = nullptr) {
+    const double scale = group[0].scale;
+    const int phase_x = group[0].phase_x, phase_y = group[0].phase_y;
+    vector<double> sum(group.size(), 0);
+    vector<int> count(group.size(), 0);
+
+    vector<bool> used(K, false);
+    for (const candidate& c : group) {
+        used[c.offset_x] = true;
+    }
+
+    luma_plane strip;
+    strip.width = ww;
+    strip.data.resize(2 * K * ww);
+    vector<vector<float>> rows(K);
+
+    for (int t = 0; (t + 1) * K <= wh; t++) {
+        // The upper half of this strip is the lower half of the previous one
+        int first = 0;
+        if (t) {
+            copy(strip.data.begin() + K * ww, strip.data.end(), strip.data.begin());
+            first = K;
+        }
+        strip.height = min(2 * K, wh - t * K);
+        resample(pyramid, scale, phase_x, phase_y, x0, y0 + t * K + first, ww, strip.height - first,
+                 &strip.data[first * ww]);
+
+        for (int ox = 0; ox < K; ox++) {
+            if (!used[ox]) {
+                continue;
+            }
+            vector<float>& r = rows[ox];
+            const int blocks = (ww - ox) / K;
+            if (t) {
+                for (int u = 0; u < K; u++) {
+                    const size_t top = static_cast<size_t>(u) * 2 * K * blocks;
+                    copy(r.begin() + top + K * blocks, r.begin() + top + 2 * K * blocks, r.begin() + top);
+                }
+            }
+            row_dct(strip, ox, first, 2 * K, r);
+
+            for (size_t g = 0; g < group.size(); g++) {
+                if (group[g].offset_x != ox || group[g].offset_y + K > strip.height) {
+                    continue;
+                }
+                for (int b = 0; b < blocks; b++) {
+                    const double y = block_projection(r, blocks, 2 * K, b, group[g].offset_y);
+                    sum[g] += lattice_score(y, delta);
+                    count[g]++;
+                    if (projections && g == 0) {
+                        projections->push_back(y);
+                    }
+                }
+            }
+        }
+    }
+
+    for (size_t g = 0; g < group.size(); g++) {
+        group[g].score = count[g] ? sum[g] / count[g] : -1;
+    }
+}
+
+// Score a group on a centered window of the given side. The window origin stays on the block
+// grid so local and global offsets agree.
+static void score_window(const vector<luma_plane>& pyramid, vector<candidate>& group, const int window,
+                         const double delta) {
+    int width, height;
+    scaled_size(pyramid, group[0].scale, group[0].phase_x, group[0].phase_y, width, height);
+    const int ww = min(window, width), wh = min(window, height);
+    const int x0 = (width - ww) / 2 / K * K, y0 = (height - wh) / 2 / K * K;
+    score_candidates(pyramid, group, x0, y0, ww, wh, delta);
+}
+
+// True when two candidates describe the same alignment
+static bool same_alignment(const candidate& a, const candidate& b) {
+    return fabs(a.scale - b.scale) < 1e-12 && a.phase_x == b.phase_x && a.phase_y == b.phase_y &&
+           a.offset_x == b.offset_x && a.offset_y == b.offset_y;
+}
+
+// Keep the best distinct candidates
+static void prune(vector<candidate>& candidates) {
+    sort(candidates.begin(), candidates.end(),
+         [](const candidate& a, const candidate& b) { return a.score > b.score; });
+    vector<candidate> kept;
+    for (const candidate& c : candidates) {
+        bool duplicate = false;
+        for (const candidate& k : kept) {
+            duplicate = duplicate || same_alignment(k, c);
+        }
+        if (!duplicate) {
+            kept.push_back(c);
+        }
+        if (static_cast<int>(kept.size()) == KEEP) {
+            break;
+        }
+    }
+    candidates.swap(kept);
+}
+
+mark_alignment detect_watermark(const bitmap_image& suspect, const bitmap_image& mark,
+                                const int original_width, const int original_height,
+                                const double delta, const vector<double>& scales) {
+    const int blocks_x = original_width / K, blocks_y = original_height / K;
+    if (blocks_x * blocks_y != mark.width() * mark.height()) {
+        throw invalid_argument("The detector needs one mark bit per block of the original image");
+    }
+    init_tables();
+
+    const vector<luma_plane> pyramid = build_pyramid(suspect);
+
+    vector<double> grid(scales);
+    if (grid.empty()) {
+        // Geometric steps out from 1 so that unscaled copies are tried exactly
+        for (double s = 1; s >= MIN_SCALE; s /= 1 + SCALE_STEP) {
+            grid.push_back(s);
+        }
+        for (double s = 1 + SCALE_STEP; s <= MAX_SCALE; s *= 1 + SCALE_STEP) {
+            grid.push_back(s);
+        }
+        // The geometric steps miss the endpoints and common resize ratios, which need to be exact
+        const double exact[] = { MIN_SCALE, 2.0 / 3, 0.75, 0.8, 1.25, 4.0 / 3, 1.5, MAX_SCALE };
+        grid.insert(grid.end(), begin(exact), end(exact));
+    }
+
+    // Stage 1: every scale, phase and offset on the smallest window
+    vector<candidate> candidates;
+    for (double s : grid) {
+        int width, height;
+        scaled_size(pyramid, s, 0, 0, width, height);
+        if (width < 2 * K || height < 2 * K) {
+            continue;
+        }
+        for (int py = 0; py < phase_count(s); py++) {
+            for (int px = 0; px < phase_count(s); px++) {
+                vector<candidate> group;
+                for (int oy = 0; oy < K; oy++) {
+                    for (int ox = 0; ox < K; ox++) {
+                        candidate c = { s, px, py, ox, oy, 0 };
+                        group.push_back(c);
+                    }
+                }
+                score_window(pyramid, group, FIRST_WINDOW, delta);
+                candidates.insert(candidates.end(), group.begin(), group.end());
+            }
+        }
+    }
+    if (candidates.empty()) {
+        throw runtime_error("Suspect image is too small to detect a watermark");
+    }
+    prune(candidates);
+
+    // Refinement: double the window and halve the scale step until the window covers the image.
+    // Only the survivors are rescored, together with their scale neighbours and the adjacent
+    // offsets (a scale that is slightly off moves the grid by a pixel or so across the window).
+    double step = SCALE_STEP / 2;
+    for (int window = 2 * FIRST_WINDOW; ; window *= 2, step /= 2) {
+        vector<candidate> next;
+        for (const candidate& c : candidates) {
+            for (int k = -1; k <= 1; k++) {
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        candidate n = { c.scale * (1 + k * step), c.phase_x, c.phase_y,
+                                        (c.offset_x + dx + K) % K, (c.offset_y + dy + K) % K, 0 };
+                        bool seen = false;
+                        for (const candidate& m : next) {
+                            seen = seen || same_alignment(m, n);
+                        }
+                        if (!seen) {
+                            next.push_back(n);
+                        }
+                    }
+                }
+            }
+        }
+
+        // Candidates with the same scale and phase share their strips and row DCTs
+        sort(next.begin(), next.end(), [](const candidate& a, const candidate& b) {
+            return a.scale != b.scale ? a.scale < b.scale : a.phase_y != b.phase_y ? a.phase_y < b.phase_y : a.phase_x < b.phase_x;
+        });
+        for (size_t first = 0, last; first < next.size(); first = last) {
+            for (last = first + 1; last < next.size() && next[last].scale == next[first].scale &&
+                 next[last].phase_x == next[first].phase_x && next[last].phase_y == next[first].phase_y; last++) {
+            }
+            vector<candidate> group(next.begin() + first, next.begin() + last);
+            score_window(pyramid, group, window, delta);
+            copy(group.begin(), group.end(), next.begin() + first);
+        }
+        candidates.swap(next);
+        prune(candidates);
+
+        int width, height;
+        scaled_size(pyramid, candidates[0].scale, candidates[0].phase_x, candidates[0].phase_y, width, height);
+        if (window >= max(width, height)) {
+            break;
+        }
+    }
+
+    // Decode every block at the best alignment, streaming the whole rescaled image
+    vector<candidate> best(1, candidates[0]);
+    int width, height;
+    scaled_size(pyramid, best[0].scale, best[0].phase_x, best[0].phase_y, width, height);
+    vector<double> projections;
+    score_candidates(pyramid, best, 0, 0, width, height, delta, &projections);
+
+    const int suspect_x = (width - best[0].offset_x) / K, suspect_y = (height - best[0].offset_y) / K;
+    vector<int> bits(suspect_x * suspect_y);
+    for (int i = 0; i < suspect_x * suspect_y; i++) {
+        const double y = projections[i];
+        bits[i] = (fabs(y - quantization_b(y, 1, delta)) < fabs(y - quantization_b(y, 0, delta))) ? 1 : 0;
+    }
+
+    vector<int> expected(blocks_x * blocks_y);
+    for (int i = 0; i < blocks_x * blocks_y; i++) {
+        expected[i] = (mark.get_pixel(i / mark.width(), i % mark.width()) == -1) ? 0 : 1;
+    }
+
+    // Find which original block the suspect grid starts at
+    mark_alignment result = { best[0].scale, best[0].phase_x, best[0].phase_y, best[0].offset_x, best[0].offset_y,
+                              0, 0, best[0].score, 1.0 };
+    for (int ky = 0; ky <= max(blocks_y - suspect_y, 0); ky++) {
+        for (int kx = 0; kx <= max(blocks_x - suspect_x, 0); kx++) {
+            int errors = 0, count = 0;
+            for (int by = 0; by < suspect_y && ky + by < blocks_y; by++) {
+                for (int bx = 0; bx < suspect_x && kx + bx < blocks_x; bx++) {
+                    errors += bits[by * suspect_x + bx] != expected[(ky + by) * blocks_x + kx + bx];
+                    count++;
+                }
+            }
+            if (count && static_cast<double>(errors) / count < result.error_rate) {
+                result.error_rate = static_cast<double>(errors) / count;
+                result.block_x = kx;
+                result.block_y = ky;
+            }
+        }
+    }
+    return result;
+}
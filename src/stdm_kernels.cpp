@@ -0,0 +1,142 @@
+/*
+ * stdm_kernels.cpp
+ *
+ * Functionality: This source file implements the batched STDM kernels with SSE2, two bits
+ * per register. Bit handling is branchless: the dither is (b - 1/2) * delta / 2, and decoding
+ * rounds onto the union of both lattices (delta/4 + k delta/2), where even k means bit 1.
+ */
+
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <emmintrin.h>
+#include "../include/stdm_kernels.h"
+#include "../include/constants.h"
+
+using namespace std;
+
+// floor for doubles that fit in an int32 (SSE2 has no rounding instruction)
+static inline __m128d floor_pd(const __m128d x) {
+    __m128d t = _mm_cvtepi32_pd(_mm_cvttpd_epi32(x));
+    return _mm_sub_pd(t, _mm_and_pd(_mm_cmpgt_pd(t, x), _mm_set1_pd(1.0)));
+}
+
+// 1 / <w, w>, so that the projection of w onto itself is 1
+static double inverse_norm(const double* w, const int N) {
+    double norm = 0;
+    for (int j = 0; j < N; j++) {
+        norm += w[j] * w[j];
+    }
+    if (norm == 0) {
+        throw invalid_argument("Spreading sequence must not be all zeros");
+    }
+    return 1 / norm;
+}
+
+// Projections of bits i and i + 1
+static inline __m128d project_pd(const double* coef, const int L, const int N, const double* w,
+                                 const int i, const __m128d inv_norm) {
+    __m128d x = _mm_setzero_pd();
+    for (int j = 0; j < N; j++) {
+        x = _mm_add_pd(x, _mm_mul_pd(_mm_loadu_pd(coef + j * L + i), _mm_set1_pd(w[j])));
+    }
+    return _mm_mul_pd(x, inv_norm);
+}
+
+static inline double project(const double* coef, const int L, const int N, const double* w,
+                             const int i, const double inv_norm) {
+    double x = 0;
+    for (int j = 0; j < N; j++) {
+        x += coef[j * L + i] * w[j];
+    }
+    return x * inv_norm;
+}
+
+void stdm_embed(double* coef, const int L, const int N, const double* w, const int* bits,
+                const double delta, double* projection) {
+    const double inv_norm = inverse_norm(w, N);
+    const __m128d vinv = _mm_set1_pd(inv_norm);
+    const __m128d vdelta = _mm_set1_pd(delta);
+    const __m128d vrdelta = _mm_set1_pd(1 / delta);
+    const __m128d vhalf = _mm_set1_pd(0.5);
+    const __m128d vdither = _mm_set1_pd(delta / 2);
+
+    int i = 0;
+    for (; i + 2 <= L; i += 2) {
+        __m128d x = project_pd(coef, L, N, w, i, vinv);
+        if (projection) {
+            _mm_storeu_pd(projection + i, x);
+        }
+
+        // d = +delta/4 for bit 1, -delta/4 for bit 0
+        __m128d b = _mm_cvtepi32_pd(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(bits + i)));
+        __m128d d = _mm_mul_pd(_mm_sub_pd(b, vhalf), vdither);
+        __m128d q = _mm_add_pd(_mm_mul_pd(vdelta, floor_pd(_mm_add_pd(_mm_mul_pd(_mm_sub_pd(x, d), vrdelta), vhalf))), d);
+        __m128d e = _mm_sub_pd(q, x);
+
+        for (int j = 0; j < N; j++) {
+            double* c = coef + j * L + i;
+            _mm_storeu_pd(c, _mm_add_pd(_mm_loadu_pd(c), _mm_mul_pd(e, _mm_set1_pd(w[j]))));
+        }
+    }
+    for (; i < L; i++) {
+        double x = project(coef, L, N, w, i, inv_norm);
+        if (projection) {
+            projection[i] = x;
+        }
+        double d = (bits[i] - 0.5) * delta / 2;
+        double e = delta * floor((x - d) / delta + 0.5) + d - x;
+        for (int j = 0; j < N; j++) {
+            coef[j * L + i] += e * w[j];
+        }
+    }
+}
+
+void stdm_decode(const double* coef, const int L, const int N, const double* w,
+                 const double delta, int* bits) {
+    const double inv_norm = inverse_norm(w, N);
+    const __m128d vinv = _mm_set1_pd(inv_norm);
+    const __m128d voffset = _mm_set1_pd(delta / 4);
+    const __m128d vrstep = _mm_set1_pd(2 / delta);
+    const __m128d vhalf = _mm_set1_pd(0.5);
+    const __m128i one = _mm_set1_epi32(1);
+
+    int i = 0;
+    for (; i + 2 <= L; i += 2) {
+        __m128d x = project_pd(coef, L, N, w, i, vinv);
+        // Index of the nearest point of the union lattice, then bit = 1 - (k & 1)
+        __m128i k = _mm_cvttpd_epi32(floor_pd(_mm_add_pd(_mm_mul_pd(_mm_sub_pd(x, voffset), vrstep), vhalf)));
+        __m128i b = _mm_xor_si128(_mm_and_si128(k, one), one);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(bits + i), b);
+    }
+    for (; i < L; i++) {
+        double x = project(coef, L, N, w, i, inv_norm);
+        long long k = static_cast<long long>(floor((x - delta / 4) * 2 / delta + 0.5));
+        bits[i] = 1 - static_cast<int>(k & 1);
+    }
+}
+
+vector<double> random_spreading(const int N, const unsigned long long seed) {
+    // Box-Muller on the raw 64-bit output, so a key gives the same sequence with every
+    // standard library (normal_distribution is implementation-defined)
+    mt19937_64 key(seed);
+    vector<double> w(N);
+    for (int j = 0; j < N; j += 2) {
+        double u1 = ((key() >> 11) + 1) * 0x1.0p-53;  // (0, 1]
+        double u2 = (key() >> 11) * 0x1.0p-53;        // [0, 1)
+        double r = sqrt(-2 * log(u1));
+        w[j] = r * cos(2 * PI * u2);
+        if (j + 1 < N) {
+            w[j + 1] = r * sin(2 * PI * u2);
+        }
+    }
+    return w;
+}
+
+vector<double> random_spreading(const int N, const string& key) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (unsigned char ch : key) {
+        hash = (hash ^ ch) * 1099511628211ULL;
+    }
+    return random_spreading(N, hash);
+}